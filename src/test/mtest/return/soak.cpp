@@ -0,0 +1,997 @@
+/*
+ * Copyright (C) 2026 Linux Studio Plugins Project <https://lsp-plug.in/>
+ *           (C) 2026 Vladimir Sadovnikov <sadko4u@gmail.com>
+ *
+ * This file is part of lsp-plugins-return
+ * Created on: 18 окт 2026 г.
+ *
+ * lsp-plugins-return is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * any later version.
+ *
+ * lsp-plugins-return is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with lsp-plugins-return. If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <lsp-plug.in/common/types.h>
+
+#ifdef PLATFORM_LINUX
+
+#include <lsp-plug.in/common/atomic.h>
+#include <lsp-plug.in/dsp/dsp.h>
+#include <lsp-plug.in/dsp-units/shared/AudioStream.h>
+#include <lsp-plug.in/ipc/Thread.h>
+#include <lsp-plug.in/plug-fw/core/AudioBuffer.h>
+#include <lsp-plug.in/plug-fw/plug.h>
+#include <lsp-plug.in/test-fw/mtest.h>
+
+#include <private/plugins/return.h>
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace
+{
+    static constexpr size_t SAMPLE_RATE         = 48000;
+    static constexpr size_t BLOCK_SIZE          = 256;
+    static constexpr size_t STREAM_BLOCKS       = 8;
+    static constexpr size_t PREFILL_BLOCKS      = STREAM_BLOCKS / 2;
+    static constexpr size_t WARMUP_BLOCKS       = 200;
+    static constexpr size_t JITTER_PERCENT      = 30;
+    static constexpr size_t STAMP_SLOTS         = 1024;
+    static constexpr size_t HIST_STEP_US        = 10;
+    static constexpr size_t HIST_BUCKETS        = 10000;
+    static constexpr size_t CACHE_LINE          = 64;
+    static constexpr size_t MAX_SECONDS         = 300;      // Keeps sample indices exact in float
+
+    static constexpr lsp::wssize_t BLOCK_PERIOD = (BLOCK_SIZE * 1000000000) / SAMPLE_RATE;
+
+    static constexpr float  IN_GAIN             = 0.5f;
+    static constexpr float  OUT_GAIN            = 0.75f;
+    static constexpr float  RETURN_GAIN         = 1.5f;
+    static constexpr float  TOLERANCE           = 1e-6f;
+
+    /**
+     * Port stub which emulates the plugin wrapper binding
+     */
+    class SoakPort: public lsp::plug::IPort
+    {
+        private:
+            float                   fValue;
+            void                   *pBuffer;
+
+        public:
+            explicit SoakPort(const lsp::meta::port_t *meta): IPort(meta)
+            {
+                fValue      = meta->start;
+                pBuffer     = NULL;
+            }
+
+        public:
+            virtual float value() override              { return fValue;    }
+            virtual void set_value(float value) override{ fValue = value;   }
+            virtual void *buffer() override             { return pBuffer;   }
+
+            void bind(void *buf)                        { pBuffer = buf;    }
+    };
+
+    /**
+     * Sender-side state, written by the sender thread only
+     */
+    typedef struct alignas(CACHE_LINE) sender_t
+    {
+        size_t                  nSent;          // Number of blocks published after the warm-up
+        size_t                  nLate;          // Number of blocks published later than one period after the deadline
+        lsp::wssize_t           nIndex;         // Index of the next sample to write, starting with 1
+        uint32_t                nSeed;          // Jitter generator state
+    } sender_t;
+
+    /**
+     * Return-side state, written by the return thread only
+     */
+    typedef struct alignas(CACHE_LINE) receiver_t
+    {
+        size_t                  nProcessed;     // Number of blocks processed after the warm-up
+        size_t                  nLate;          // Number of blocks processed later than one period after the deadline
+        size_t                  nUnderruns;     // Number of blocks with silence or repeated data
+        size_t                  nSkipped;       // Number of samples skipped by the stream
+        size_t                  nTorn;          // Number of blocks with non-contiguous data from the stream
+        size_t                  nCorrupted;     // Number of blocks with unexpected plugin output
+        lsp::wssize_t           nIndex;         // Index of the last sample received
+        lsp::wssize_t           nMaxLatency;    // Maximum end-to-end latency, microseconds
+        lsp::wssize_t           nProcTime;      // Total time spent in stream read and process(), nanoseconds
+        lsp::wssize_t           nMaxProcTime;   // Maximum time spent in stream read and process(), nanoseconds
+        uint32_t                nSeed;          // Jitter generator state
+        uint32_t                vHist[HIST_BUCKETS]; // End-to-end latency histogram
+    } receiver_t;
+
+    /**
+     * Common state of one sender/return pair
+     */
+    typedef struct alignas(CACHE_LINE) link_t
+    {
+        // Read-only while threads are running
+        lsp::dspu::AudioStream *pSendStream;    // Stream as created by the sender
+        lsp::dspu::AudioStream *pRecvStream;    // Stream as opened by the return side
+        lsp::uatomic_t         *vStamps;        // Publish time of each block, nanoseconds
+        size_t                  nChannels;
+        size_t                  nCpus;          // Number of CPUs to confine threads to, 0 if not confined
+        lsp::wssize_t           nStart;         // Start of the common block grid, nanoseconds
+
+        alignas(CACHE_LINE) lsp::uatomic_t nStop;
+        sender_t                sSender;
+        receiver_t              sReceiver;
+    } link_t;
+
+    static lsp::wssize_t time_ns()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return lsp::wssize_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+    }
+
+    static void wait_until(lsp::wssize_t deadline)
+    {
+        struct timespec ts;
+        ts.tv_sec           = deadline / 1000000000;
+        ts.tv_nsec          = deadline % 1000000000;
+
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+            /* nothing */ ;
+    }
+
+    static void confine_thread(size_t cpus)
+    {
+        if (cpus == 0)
+            return;
+
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (size_t i=0; i<cpus; ++i)
+            CPU_SET(i, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+
+    static uint32_t next_random(uint32_t *seed)
+    {
+        uint32_t x  = *seed;
+        x          ^= x << 13;
+        x          ^= x >> 17;
+        x          ^= x << 5;
+        *seed       = x;
+        return x;
+    }
+
+    static inline lsp::wssize_t grid_time(lsp::wssize_t start, lsp::wssize_t k)
+    {
+        return start + (k * BLOCK_SIZE * 1000000000) / SAMPLE_RATE;
+    }
+
+    /**
+     * Compute the deadline of the k-th block: the point on the fixed grid with the jitter
+     * applied, so the jitter does not accumulate into clock drift.
+     */
+    static lsp::wssize_t block_deadline(lsp::wssize_t start, lsp::wssize_t k, uint32_t *seed)
+    {
+        const lsp::wssize_t range   = (BLOCK_PERIOD * JITTER_PERCENT) / 100;
+        const lsp::wssize_t delta   = lsp::wssize_t(next_random(seed) % (2 * range + 1)) - range;
+        return grid_time(start, k) + delta;
+    }
+
+    /**
+     * Each sample carries its own stream position: the first channel holds the index,
+     * the second one holds the negated index. Silence means no data.
+     */
+    static inline float stream_sample(lsp::wssize_t index, size_t channel)
+    {
+        return (channel == 0) ? float(index) : -float(index);
+    }
+
+    static inline float input_sample(size_t channel, size_t index)
+    {
+        return float((channel * 13 + index) & 0xff) / 256.0f;
+    }
+
+    /**
+     * Simulated sender instance: writes jittered blocks into the audio stream
+     */
+    class SenderThread: public lsp::ipc::Thread
+    {
+        private:
+            link_t                 *pLink;
+            float                   vBuf[BLOCK_SIZE];
+
+        public:
+            explicit SenderThread(link_t *link)
+            {
+                pLink       = link;
+            }
+
+        public:
+            lsp::status_t publish(lsp::wssize_t stamp)
+            {
+                sender_t *s         = &pLink->sSender;
+                lsp::dspu::AudioStream *stream = pLink->pSendStream;
+
+                const size_t block  = (s->nIndex - 1) / BLOCK_SIZE;
+                lsp::atomic_store(&pLink->vStamps[block % STAMP_SLOTS], lsp::uatomic_t(stamp));
+
+                lsp::status_t res   = stream->begin(BLOCK_SIZE);
+                if (res != lsp::STATUS_OK)
+                    return res;
+                for (size_t i=0; i<pLink->nChannels; ++i)
+                {
+                    for (size_t j=0; j<BLOCK_SIZE; ++j)
+                        vBuf[j]             = stream_sample(s->nIndex + j, i);
+                    if ((res = stream->write(i, vBuf, BLOCK_SIZE)) != lsp::STATUS_OK)
+                        break;
+                }
+                const lsp::status_t res2 = stream->end();
+                if (res == lsp::STATUS_OK)
+                    res                 = res2;
+
+                s->nIndex          += BLOCK_SIZE;
+
+                return res;
+            }
+
+            virtual lsp::status_t run() override
+            {
+                sender_t *s         = &pLink->sSender;
+                confine_thread(pLink->nCpus);
+
+                for (lsp::wssize_t k = 0; !lsp::atomic_load(&pLink->nStop); ++k)
+                {
+                    const lsp::wssize_t deadline = block_deadline(pLink->nStart, k, &s->nSeed);
+                    wait_until(deadline);
+
+                    publish(time_ns());
+                    const lsp::wssize_t end = time_ns();
+
+                    if (k < lsp::wssize_t(WARMUP_BLOCKS))
+                        continue;
+                    ++s->nSent;
+                    if (end > deadline + BLOCK_PERIOD)
+                        ++s->nLate;
+                }
+
+                return lsp::STATUS_OK;
+            }
+    };
+
+    /**
+     * Return plugin instance driven by the jittered host clock
+     */
+    class ReturnThread: public lsp::ipc::Thread
+    {
+        private:
+            link_t                     *pLink;
+            lsp::plugins::Return       *pPlugin;
+            lsp::core::AudioBuffer     *vReturn;
+            const float                *vIn;
+            const float                *vOut;
+
+        protected:
+            static inline bool matches(float value, float expect)
+            {
+                return fabsf(value - expect) <= TOLERANCE * lsp_max(1.0f, fabsf(expect));
+            }
+
+            bool verify_output()
+            {
+                for (size_t i=0; i<pLink->nChannels; ++i)
+                {
+                    const float *retn   = vReturn[i].buffer();
+                    for (size_t j=0; j<BLOCK_SIZE; ++j)
+                    {
+                        const size_t off    = i * BLOCK_SIZE + j;
+                        const float expect  = vIn[off] * IN_GAIN * OUT_GAIN + retn[j] * RETURN_GAIN * OUT_GAIN;
+                        if (!matches(vOut[off], expect))
+                            return false;
+                    }
+                }
+                return true;
+            }
+
+            /**
+             * Check the data delivered by the stream and classify the block. Silent samples
+             * are allowed anywhere and mean missing data, all other samples should belong
+             * to one contiguous run of the sender's stream.
+             */
+            void verify_stream(receiver_t *r, bool measure, lsp::wssize_t end)
+            {
+                const float *head       = vReturn[0].buffer();
+                ssize_t first = -1, last = -1;
+                for (size_t j=0; j<BLOCK_SIZE; ++j)
+                {
+                    if (head[j] == 0.0f)
+                        continue;
+                    if (first < 0)
+                        first                   = j;
+                    last                    = j;
+                }
+
+                const lsp::wssize_t base = (first >= 0) ? lsp::wssize_t(head[first]) - first : 0;
+                bool torn               = false;
+                for (size_t i=0; (i<pLink->nChannels) && (!torn); ++i)
+                {
+                    const float *src        = vReturn[i].buffer();
+                    for (size_t j=0; j<BLOCK_SIZE; ++j)
+                    {
+                        const float expect      = (head[j] != 0.0f) ? stream_sample(base + j, i) : 0.0f;
+                        if (src[j] != expect)
+                        {
+                            torn                    = true;
+                            break;
+                        }
+                    }
+                }
+
+                if (torn)
+                {
+                    if (measure)
+                        ++r->nTorn;
+                    return;
+                }
+
+                // Silence, partial silence or data which has been already received
+                if (first < 0)
+                {
+                    if (measure)
+                        ++r->nUnderruns;
+                    return;
+                }
+
+                const lsp::wssize_t from = base + first;
+                const lsp::wssize_t to  = base + last;
+                const bool partial      = (last - first + 1) < ssize_t(BLOCK_SIZE);
+                if ((measure) && ((partial) || (from <= r->nIndex)))
+                    ++r->nUnderruns;
+                if (to <= r->nIndex)
+                    return;
+
+                if (measure)
+                {
+                    if (from > r->nIndex + 1)
+                        r->nSkipped            += from - r->nIndex - 1;
+
+                    const size_t block      = (to - 1) / BLOCK_SIZE;
+                    const lsp::wssize_t stamp = lsp::atomic_load(&pLink->vStamps[block % STAMP_SLOTS]);
+                    const lsp::wssize_t latency = (end - stamp) / 1000;
+                    r->nMaxLatency          = lsp_max(r->nMaxLatency, latency);
+                    const size_t bucket     = lsp_min(size_t(lsp_max(latency, lsp::wssize_t(0)) / HIST_STEP_US), HIST_BUCKETS - 1);
+                    ++r->vHist[bucket];
+                }
+                r->nIndex               = to;
+            }
+
+        public:
+            explicit ReturnThread(link_t *link, lsp::plugins::Return *plugin,
+                lsp::core::AudioBuffer *retn, const float *in, const float *out)
+            {
+                pLink       = link;
+                pPlugin     = plugin;
+                vReturn     = retn;
+                vIn         = in;
+                vOut        = out;
+            }
+
+        public:
+            virtual lsp::status_t run() override
+            {
+                receiver_t *r           = &pLink->sReceiver;
+                lsp::dspu::AudioStream *stream = pLink->pRecvStream;
+                lsp::dsp::context_t ctx;
+
+                confine_thread(pLink->nCpus);
+
+                for (lsp::wssize_t k = 0; !lsp::atomic_load(&pLink->nStop); ++k)
+                {
+                    const lsp::wssize_t deadline = block_deadline(pLink->nStart, k, &r->nSeed);
+                    wait_until(deadline);
+
+                    const lsp::wssize_t start   = time_ns();
+                    lsp::dsp::start(&ctx);
+
+                    // Read the stream into the return buffers as the wrapper does
+                    if (stream->begin(BLOCK_SIZE) == lsp::STATUS_OK)
+                    {
+                        for (size_t i=0; i<pLink->nChannels; ++i)
+                        {
+                            float *dst  = vReturn[i].buffer();
+                            if (stream->read(i, dst, BLOCK_SIZE) != lsp::STATUS_OK)
+                                lsp::dsp::fill_zero(dst, BLOCK_SIZE);
+                        }
+                        stream->end();
+                    }
+                    else
+                    {
+                        for (size_t i=0; i<pLink->nChannels; ++i)
+                            lsp::dsp::fill_zero(vReturn[i].buffer(), BLOCK_SIZE);
+                    }
+
+                    // Process the block
+                    pPlugin->process(BLOCK_SIZE);
+
+                    lsp::dsp::finish(&ctx);
+                    const lsp::wssize_t end     = time_ns();
+
+                    // Update statistics, the bypass fade-in is also covered by the warm-up
+                    const bool measure          = k >= lsp::wssize_t(WARMUP_BLOCKS);
+                    if (measure)
+                    {
+                        ++r->nProcessed;
+                        r->nProcTime               += end - start;
+                        r->nMaxProcTime             = lsp_max(r->nMaxProcTime, end - start);
+                        if (end > deadline + BLOCK_PERIOD)
+                            ++r->nLate;
+                        if (!verify_output())
+                            ++r->nCorrupted;
+                    }
+
+                    verify_stream(r, measure, end);
+                }
+
+                return lsp::STATUS_OK;
+            }
+    };
+
+    /**
+     * Background load which competes with sender and return threads for the CPU
+     */
+    class BurnerThread: public lsp::ipc::Thread
+    {
+        private:
+            lsp::uatomic_t         *pStop;
+            size_t                  nCpus;
+
+        public:
+            explicit BurnerThread(lsp::uatomic_t *stop, size_t cpus)
+            {
+                pStop       = stop;
+                nCpus       = cpus;
+            }
+
+        public:
+            virtual lsp::status_t run() override
+            {
+                volatile float acc  = 0.0f;
+                confine_thread(nCpus);
+
+                while (!lsp::atomic_load(pStop))
+                {
+                    for (size_t i=0; i<4096; ++i)
+                        acc             = acc * 0.999f + 1.0f;
+                }
+
+                return lsp::STATUS_OK;
+            }
+    };
+} /* namespace */
+
+MTEST_BEGIN("return", soak)
+
+    typedef struct config_t
+    {
+        size_t                      nInstances;     // Maximum number of sender/return pairs
+        size_t                      nSeconds;       // Duration of each step
+        size_t                      nCpus;          // Number of CPUs to confine all threads to, 0 if not confined
+        size_t                      nBurners;       // Number of background CPU burner threads
+        const lsp::meta::plugin_t  *pMeta;          // Plugin metadata
+        double                      fMaxDropouts;   // Maximum allowed underrun/overrun/late rate, percent
+        lsp::wssize_t               nMaxP99;        // Maximum allowed p99 latency, microseconds
+    } config_t;
+
+    typedef struct instance_t
+    {
+        link_t                     *pLink;
+        lsp::plugins::Return       *pPlugin;
+        SoakPort                  **vPorts;
+        size_t                      nPorts;
+        lsp::core::AudioBuffer     *vReturn;
+        float                      *vIn;
+        float                      *vOut;
+        SenderThread               *pSender;
+        ReturnThread               *pReturn;
+        lsp::wssize_t               nCreateTime;    // Time to create the stream, nanoseconds
+        lsp::wssize_t               nOpenTime;      // Time to open the stream, nanoseconds
+        char                        sName[64];      // Name of the return connection
+    } instance_t;
+
+    typedef struct totals_t
+    {
+        size_t                      nSent;
+        size_t                      nSenderLate;
+        size_t                      nProcessed;
+        size_t                      nReturnLate;
+        size_t                      nUnderruns;
+        size_t                      nSkipped;
+        size_t                      nTorn;
+        size_t                      nCorrupted;
+        lsp::wssize_t               nMaxLatency;
+        lsp::wssize_t               nProcTime;
+        lsp::wssize_t               nMaxProcTime;
+        lsp::wssize_t               nCreateTime;
+        lsp::wssize_t               nOpenTime;
+        uint32_t                    vHist[HIST_BUCKETS];
+    } totals_t;
+
+    SoakPort *find_port(instance_t *inst, const char *id)
+    {
+        for (size_t i=0; i<inst->nPorts; ++i)
+            if (!strcmp(inst->vPorts[i]->metadata()->id, id))
+                return inst->vPorts[i];
+        return NULL;
+    }
+
+    SoakPort *find_port(instance_t *inst, size_t role)
+    {
+        for (size_t i=0; i<inst->nPorts; ++i)
+            if (size_t(inst->vPorts[i]->metadata()->role) == role)
+                return inst->vPorts[i];
+        return NULL;
+    }
+
+    void set_port(instance_t *inst, const char *id, float value)
+    {
+        SoakPort *port = find_port(inst, id);
+        MTEST_ASSERT_MSG(port != NULL, "Port '%s' not found", id);
+        port->set_value(value);
+    }
+
+    void init_instance(instance_t *inst, const config_t *cfg, size_t index)
+    {
+        const lsp::meta::plugin_t *meta = cfg->pMeta;
+        const size_t channels   = (meta == &lsp::meta::return_stereo) ? 2 : 1;
+
+        snprintf(inst->sName, sizeof(inst->sName), "lsp-return-soak-%d-%d", int(getpid()), int(index));
+        inst->nCreateTime       = 0;
+        inst->nOpenTime         = 0;
+
+        void *ptr               = NULL;
+        MTEST_ASSERT(posix_memalign(&ptr, CACHE_LINE, sizeof(link_t)) == 0);
+        inst->pLink             = static_cast<link_t *>(ptr);
+        memset(inst->pLink, 0, sizeof(link_t));
+        inst->pLink->nChannels  = channels;
+        inst->pLink->nCpus      = cfg->nCpus;
+        inst->pLink->sSender.nIndex     = 1;
+        inst->pLink->sSender.nSeed      = 0x9e3779b9 ^ (index * 2 + 1);
+        inst->pLink->sReceiver.nSeed    = 0x85ebca6b ^ (index * 2 + 2);
+
+        inst->pLink->vStamps    = static_cast<lsp::uatomic_t *>(malloc(sizeof(lsp::uatomic_t) * STAMP_SLOTS));
+        MTEST_ASSERT(inst->pLink->vStamps != NULL);
+        memset(inst->pLink->vStamps, 0, sizeof(lsp::uatomic_t) * STAMP_SLOTS);
+
+        inst->vIn               = static_cast<float *>(malloc(sizeof(float) * channels * BLOCK_SIZE));
+        inst->vOut              = static_cast<float *>(malloc(sizeof(float) * channels * BLOCK_SIZE));
+        MTEST_ASSERT(inst->vIn != NULL);
+        MTEST_ASSERT(inst->vOut != NULL);
+        for (size_t i=0; i<channels; ++i)
+            for (size_t j=0; j<BLOCK_SIZE; ++j)
+                inst->vIn[i * BLOCK_SIZE + j]   = input_sample(i, j);
+
+        inst->vReturn           = new lsp::core::AudioBuffer[channels];
+        for (size_t i=0; i<channels; ++i)
+        {
+            MTEST_ASSERT(inst->vReturn[i].set_size(BLOCK_SIZE));
+            inst->vReturn[i].set_active(true);
+        }
+
+        // Create ports and bind buffers in the same way as the wrapper does
+        inst->nPorts            = 0;
+        for (const lsp::meta::port_t *p = meta->ports; p->id != NULL; ++p)
+            ++inst->nPorts;
+        inst->vPorts            = static_cast<SoakPort **>(malloc(sizeof(SoakPort *) * inst->nPorts));
+        MTEST_ASSERT(inst->vPorts != NULL);
+
+        size_t in_id = 0, out_id = 0, retn_id = 0;
+        for (size_t i=0; i<inst->nPorts; ++i)
+        {
+            const lsp::meta::port_t *p  = &meta->ports[i];
+            SoakPort *port      = new SoakPort(p);
+            inst->vPorts[i]     = port;
+
+            if (lsp::meta::is_audio_in_port(p))
+                port->bind(&inst->vIn[(in_id++) * BLOCK_SIZE]);
+            else if (lsp::meta::is_audio_out_port(p))
+                port->bind(&inst->vOut[(out_id++) * BLOCK_SIZE]);
+            else if (p->role == lsp::meta::R_AUDIO_RETURN)
+                port->bind(&inst->vReturn[retn_id++]);
+        }
+
+        // The wrapper translates the bypass port, the plugin sees 0 when not bypassed
+        SoakPort *bypass        = find_port(inst, size_t(lsp::meta::R_BYPASS));
+        MTEST_ASSERT_MSG(bypass != NULL, "Bypass port not found");
+        bypass->set_value(0.0f);
+
+        set_port(inst, "mode", 0.0f);
+        set_port(inst, "g_in", IN_GAIN);
+        set_port(inst, "g_out", OUT_GAIN);
+        set_port(inst, "g_retn", RETURN_GAIN);
+
+        // Create and initialize the plugin
+        inst->pPlugin           = new lsp::plugins::Return(meta);
+        inst->pPlugin->init(NULL, reinterpret_cast<lsp::plug::IPort **>(inst->vPorts));
+        inst->pPlugin->update_sample_rate(SAMPLE_RATE);
+        inst->pPlugin->update_settings();
+
+        inst->pSender           = new SenderThread(inst->pLink);
+        inst->pReturn           = new ReturnThread(inst->pLink, inst->pPlugin, inst->vReturn, inst->vIn, inst->vOut);
+    }
+
+    void close_streams(instance_t *inst)
+    {
+        link_t *link            = inst->pLink;
+
+        if (link->pRecvStream != NULL)
+        {
+            link->pRecvStream->close();
+            delete link->pRecvStream;
+            link->pRecvStream       = NULL;
+        }
+        if (link->pSendStream != NULL)
+        {
+            link->pSendStream->close();
+            delete link->pSendStream;
+            link->pSendStream       = NULL;
+        }
+    }
+
+    /**
+     * Create the stream on the sender side, open it on the return side and prime it
+     * up to the target depth. Does not assert, so nothing is left behind in the shared
+     * memory on failure.
+     */
+    lsp::status_t open_streams(instance_t *inst)
+    {
+        link_t *link            = inst->pLink;
+
+        const lsp::wssize_t t1  = time_ns();
+        link->pSendStream       = new lsp::dspu::AudioStream();
+        lsp::status_t res       = link->pSendStream->create(inst->sName, link->nChannels, STREAM_BLOCKS * BLOCK_SIZE);
+        if (res != lsp::STATUS_OK)
+            return res;
+
+        const lsp::wssize_t t2  = time_ns();
+        link->pRecvStream       = new lsp::dspu::AudioStream();
+        if ((res = link->pRecvStream->open(inst->sName)) != lsp::STATUS_OK)
+            return res;
+        const lsp::wssize_t t3  = time_ns();
+
+        inst->nCreateTime       = t2 - t1;
+        inst->nOpenTime         = t3 - t2;
+
+        for (size_t i=0; i<PREFILL_BLOCKS; ++i)
+            if ((res = inst->pSender->publish(time_ns())) != lsp::STATUS_OK)
+                return res;
+
+        return lsp::STATUS_OK;
+    }
+
+    void destroy_instance(instance_t *inst)
+    {
+        close_streams(inst);
+
+        delete inst->pSender;
+        delete inst->pReturn;
+
+        inst->pPlugin->destroy();
+        delete inst->pPlugin;
+
+        for (size_t i=0; i<inst->nPorts; ++i)
+            delete inst->vPorts[i];
+        free(inst->vPorts);
+
+        delete [] inst->vReturn;
+        free(inst->vIn);
+        free(inst->vOut);
+
+        free(inst->pLink->vStamps);
+        free(inst->pLink);
+    }
+
+    lsp::wssize_t percentile(const uint32_t *hist, size_t total, double p)
+    {
+        if (total == 0)
+            return -1;
+
+        const size_t limit  = size_t(total * p);
+        size_t count        = 0;
+        for (size_t i=0; i<HIST_BUCKETS; ++i)
+        {
+            count              += hist[i];
+            if (count > limit)
+                return (i + 1) * HIST_STEP_US;
+        }
+        return HIST_BUCKETS * HIST_STEP_US;
+    }
+
+    const char *format_us(char *buf, size_t len, lsp::wssize_t value)
+    {
+        if (value < 0)
+            return "n/a";
+        snprintf(buf, len, "%d", int(value));
+        return buf;
+    }
+
+    static inline double rate(size_t count, size_t total)
+    {
+        return (total > 0) ? 100.0 * double(count) / double(total) : 0.0;
+    }
+
+    void merge_stats(totals_t *t, const instance_t *inst)
+    {
+        const sender_t *s   = &inst->pLink->sSender;
+        const receiver_t *r = &inst->pLink->sReceiver;
+
+        t->nSent           += s->nSent;
+        t->nSenderLate     += s->nLate;
+        t->nProcessed      += r->nProcessed;
+        t->nReturnLate     += r->nLate;
+        t->nUnderruns      += r->nUnderruns;
+        t->nSkipped        += r->nSkipped;
+        t->nTorn           += r->nTorn;
+        t->nCorrupted      += r->nCorrupted;
+        t->nProcTime       += r->nProcTime;
+        t->nMaxProcTime     = lsp_max(t->nMaxProcTime, r->nMaxProcTime);
+        t->nMaxLatency      = lsp_max(t->nMaxLatency, r->nMaxLatency);
+        t->nCreateTime     += inst->nCreateTime;
+        t->nOpenTime       += inst->nOpenTime;
+        for (size_t j=0; j<HIST_BUCKETS; ++j)
+            t->vHist[j]        += r->vHist[j];
+    }
+
+    void stop_threads(instance_t *vInst, size_t count, size_t started, BurnerThread **vBurners, size_t burners, lsp::uatomic_t *stop)
+    {
+        for (size_t i=0; i<count; ++i)
+            lsp::atomic_store(&vInst[i].pLink->nStop, lsp::uatomic_t(1));
+        lsp::atomic_store(stop, lsp::uatomic_t(1));
+
+        for (size_t i=0; i<started; ++i)
+        {
+            vInst[i].pSender->join();
+            vInst[i].pReturn->join();
+        }
+        for (size_t i=0; i<burners; ++i)
+        {
+            if (vBurners[i] == NULL)
+                continue;
+            vBurners[i]->join();
+            delete vBurners[i];
+        }
+    }
+
+    void run_step(const config_t *cfg, size_t count, bool *passed)
+    {
+        instance_t *vInst   = static_cast<instance_t *>(malloc(sizeof(instance_t) * count));
+        BurnerThread **vBurners = static_cast<BurnerThread **>(malloc(sizeof(BurnerThread *) * (cfg->nBurners + 1)));
+        totals_t *total     = static_cast<totals_t *>(malloc(sizeof(totals_t)));
+        MTEST_ASSERT(vInst != NULL);
+        MTEST_ASSERT(vBurners != NULL);
+        MTEST_ASSERT(total != NULL);
+        memset(total, 0, sizeof(totals_t));
+
+        for (size_t i=0; i<count; ++i)
+            init_instance(&vInst[i], cfg, i);
+
+        // Shared memory is touched only after all setup assertions have passed
+        lsp::status_t res   = lsp::STATUS_OK;
+        for (size_t i=0; (i<count) && (res == lsp::STATUS_OK); ++i)
+            res                 = open_streams(&vInst[i]);
+
+        // Start background load, put all pairs on the common block grid, senders start first
+        lsp::uatomic_t stop = 0;
+        size_t started      = 0;
+        for (size_t i=0; i<cfg->nBurners; ++i)
+        {
+            vBurners[i]         = NULL;
+            if (res != lsp::STATUS_OK)
+                continue;
+            vBurners[i]         = new BurnerThread(&stop, cfg->nCpus);
+            res                 = vBurners[i]->start();
+        }
+
+        const lsp::wssize_t start = time_ns() + 10000000;
+        for (size_t i=0; i<count; ++i)
+            vInst[i].pLink->nStart  = start;
+        for ( ; (started < count) && (res == lsp::STATUS_OK); ++started)
+        {
+            if ((res = vInst[started].pSender->start()) != lsp::STATUS_OK)
+                break;
+            if ((res = vInst[started].pReturn->start()) != lsp::STATUS_OK)
+            {
+                lsp::atomic_store(&vInst[started].pLink->nStop, lsp::uatomic_t(1));
+                vInst[started].pSender->join();
+                break;
+            }
+        }
+
+        if (res == lsp::STATUS_OK)
+            wait_until(grid_time(start, WARMUP_BLOCKS) + lsp::wssize_t(cfg->nSeconds) * 1000000000);
+
+        stop_threads(vInst, count, started, vBurners, cfg->nBurners, &stop);
+
+        for (size_t i=0; i<count; ++i)
+            merge_stats(total, &vInst[i]);
+        for (size_t i=0; i<count; ++i)
+            destroy_instance(&vInst[i]);
+        free(vInst);
+        free(vBurners);
+
+        if (res != lsp::STATUS_OK)
+        {
+            free(total);
+            MTEST_ASSERT_MSG(false, "Failed to start step with %d instances, error code=%d", int(count), int(res));
+            return;
+        }
+
+        // Compute metrics: dropouts are relative to the side which counted them
+        const size_t delivered  = total->nProcessed - lsp_min(total->nProcessed, total->nUnderruns + total->nTorn);
+        const double underruns  = rate(total->nUnderruns, total->nProcessed);
+        const double overruns   = rate(total->nSkipped / BLOCK_SIZE, total->nSent);
+        const double late       = rate(total->nReturnLate + total->nSenderLate, total->nProcessed + total->nSent);
+        const double proc_avg   = (total->nProcessed > 0) ?
+            double(total->nProcTime) / double(total->nProcessed) : 0.0;
+        const double rt_avg     = (proc_avg > 0.0) ? double(BLOCK_PERIOD) / proc_avg : 0.0;
+        const double rt_min     = (total->nMaxProcTime > 0) ? double(BLOCK_PERIOD) / double(total->nMaxProcTime) : 0.0;
+        const lsp::wssize_t p50 = percentile(total->vHist, delivered, 0.5);
+        const lsp::wssize_t p99 = percentile(total->vHist, delivered, 0.99);
+        const lsp::wssize_t p999= percentile(total->vHist, delivered, 0.999);
+
+        const bool ok           =
+            (total->nCorrupted == 0) &&
+            (total->nTorn == 0) &&
+            (underruns <= cfg->fMaxDropouts) &&
+            (overruns <= cfg->fMaxDropouts) &&
+            (late <= cfg->fMaxDropouts) &&
+            (p99 >= 0) &&
+            (p99 <= cfg->nMaxP99);
+
+        char b50[32], b99[32], b999[32], bmax[32];
+        printf("%4d | %7.3f%% | %7.3f%% | %7.3f%% | %4d | %4d | %8.1f | %8.1f | %7.1f | %8.1f | %8.1f | %7s | %7s | %7s | %7s | %s\n",
+            int(count),
+            underruns,
+            overruns,
+            late,
+            int(total->nTorn),
+            int(total->nCorrupted),
+            double(total->nCreateTime) / double(count * 1000),
+            double(total->nOpenTime) / double(count * 1000),
+            proc_avg / 1000.0,
+            rt_avg,
+            rt_min,
+            format_us(b50, sizeof(b50), p50),
+            format_us(b99, sizeof(b99), p99),
+            format_us(b999, sizeof(b999), p999),
+            format_us(bmax, sizeof(bmax), (delivered > 0) ? total->nMaxLatency : -1),
+            (ok) ? "ok" : "FAIL");
+
+        free(total);
+
+        if (!ok)
+            *passed     = false;
+    }
+
+    static inline bool is_key(const char *arg, size_t len, const char *key)
+    {
+        return (len == strlen(key)) && (!strncmp(arg, key, len));
+    }
+
+    void parse_args(config_t *cfg, int argc, const char **argv)
+    {
+        const long cores    = sysconf(_SC_NPROCESSORS_ONLN);
+
+        // Default limits: no more than 0.1% of dropouts and p99 latency within two blocks above the prefill
+        cfg->nInstances     = lsp_max(size_t(16), size_t(lsp_max(cores, 1L)) * 2);
+        cfg->nSeconds       = 5;
+        cfg->nCpus          = 0;
+        cfg->nBurners       = 0;
+        cfg->pMeta          = &lsp::meta::return_stereo;
+        cfg->fMaxDropouts   = 0.1;
+        cfg->nMaxP99        = ((PREFILL_BLOCKS + 2) * BLOCK_SIZE * 1000000) / SAMPLE_RATE;
+
+        for (int i=0; i<argc; ++i)
+        {
+            const char *arg     = argv[i];
+            const char *value   = strchr(arg, '=');
+            MTEST_ASSERT_MSG(value != NULL, "Invalid argument '%s', expected key=value", arg);
+            const size_t len    = value++ - arg;
+            char *tail          = NULL;
+
+            if (is_key(arg, len, "n"))
+            {
+                const long n        = strtol(value, &tail, 10);
+                MTEST_ASSERT_MSG((*tail == '\0') && (n >= 1), "Invalid number of instances: '%s'", value);
+                cfg->nInstances     = n;
+            }
+            else if (is_key(arg, len, "time"))
+            {
+                const long n        = strtol(value, &tail, 10);
+                MTEST_ASSERT_MSG((*tail == '\0') && (n >= 1) && (n <= long(MAX_SECONDS)),
+                    "Invalid step duration: '%s', expected 1..%d seconds", value, int(MAX_SECONDS));
+                cfg->nSeconds       = n;
+            }
+            else if (is_key(arg, len, "cpus"))
+            {
+                const long n        = strtol(value, &tail, 10);
+                MTEST_ASSERT_MSG((*tail == '\0') && (n >= 0) && (n <= lsp_max(cores, 1L)) && (n <= CPU_SETSIZE),
+                    "Invalid number of CPUs: '%s'", value);
+                cfg->nCpus          = n;
+            }
+            else if (is_key(arg, len, "burn"))
+            {
+                const long n        = strtol(value, &tail, 10);
+                MTEST_ASSERT_MSG((*tail == '\0') && (n >= 0), "Invalid number of burner threads: '%s'", value);
+                cfg->nBurners       = n;
+            }
+            else if (is_key(arg, len, "layout"))
+            {
+                if (!strcmp(value, "mono"))
+                    cfg->pMeta          = &lsp::meta::return_mono;
+                else if (!strcmp(value, "stereo"))
+                    cfg->pMeta          = &lsp::meta::return_stereo;
+                else
+                    MTEST_ASSERT_MSG(false, "Invalid layout: '%s', expected mono or stereo", value);
+            }
+            else if (is_key(arg, len, "dropouts"))
+            {
+                const double v      = strtod(value, &tail);
+                MTEST_ASSERT_MSG((*tail == '\0') && (v >= 0.0), "Invalid dropout limit: '%s'", value);
+                cfg->fMaxDropouts   = v;
+            }
+            else if (is_key(arg, len, "p99"))
+            {
+                const long n        = strtol(value, &tail, 10);
+                MTEST_ASSERT_MSG((*tail == '\0') && (n >= 1), "Invalid p99 limit: '%s'", value);
+                cfg->nMaxP99        = n;
+            }
+            else
+                MTEST_ASSERT_MSG(false, "Unknown argument '%s'", arg);
+        }
+    }
+
+    MTEST_MAIN
+    {
+        // Usage: [n=<max pairs>] [time=<seconds>] [cpus=<count>] [burn=<threads>] [layout=mono|stereo]
+        //        [dropouts=<max percent>] [p99=<max microseconds>]
+        config_t cfg;
+        parse_args(&cfg, argc, argv);
+
+        lsp::dsp::init();
+
+        printf("Plugin: %s, sample rate: %d, block size: %d, jitter: +/-%d%%\n",
+            cfg.pMeta->uid, int(SAMPLE_RATE), int(BLOCK_SIZE), int(JITTER_PERCENT));
+        printf("Stream: %d blocks, prefill: %d blocks, warm-up: %d blocks, step: %d s\n",
+            int(STREAM_BLOCKS), int(PREFILL_BLOCKS), int(WARMUP_BLOCKS), int(cfg.nSeconds));
+        printf("Load: %d CPUs (0 = all), %d burner threads\n", int(cfg.nCpus), int(cfg.nBurners));
+        printf("Limits: underruns/overruns/late <= %.3f%%, p99 <= %d us\n",
+            cfg.fMaxDropouts, int(cfg.nMaxP99));
+        printf("   N | underr   | overr    | late     | torn | bad  | create us| open us  | proc us | rt avg   | rt min   | p50 us  | p99 us  | p999 us | max us  | status\n");
+
+        bool passed = true;
+        for (size_t count = 1; ; count = lsp_min(count * 2, cfg.nInstances))
+        {
+            run_step(&cfg, count, &passed);
+            if (count >= cfg.nInstances)
+                break;
+        }
+
+        MTEST_ASSERT_MSG(passed, "Some steps exceeded the configured limits");
+    }
+
+MTEST_END
+
+#endif /* PLATFORM_LINUX */